@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "malloc.h"
 
 typedef struct Header {
     void *mem_start;
@@ -20,9 +27,23 @@ typedef struct Header {
 #define HEAP_CHUNK_SIZ (MIN_UNIT * 4000)
 #define MIN_FREE_CHUNK_SIZ (MIN_UNIT * 10)
 
+#define MAX_REGIONS 64
+#define HEAPDUMP_ENV "MALLOC_HEAPDUMP"
+#define PREFAULT_ENV "MALLOC_PREFAULT"
+
 char bugbuf[BUGBUF_SIZ];
 struct Header *heapstart = NULL;
 
+// Each stretch of memory handed out by one call to sbrk
+struct Region {
+    void *start;
+    size_t size;
+};
+static struct Region regions[MAX_REGIONS];
+static int regioncount = 0;
+static int envinit = 0;
+static int prefault = 0;
+
 static void throwmsg(const char *msg)
 {
     #if DEBUG_MALLOC
@@ -31,6 +52,23 @@ static void throwmsg(const char *msg)
     #endif
 }
 
+static void writemsg(int fd, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(bugbuf, BUGBUF_SIZ, fmt, args);
+    va_end(args);
+    // Only write what actually made it into the buffer
+    if(len >= BUGBUF_SIZ)
+    {
+        len = BUGBUF_SIZ - 1;
+    }
+    if(len > 0)
+    {
+        write(fd, bugbuf, len);
+    }
+}
+
 static size_t headersize()
 {
     // Round the size of the header to the closest
@@ -280,12 +318,20 @@ static int getmem(Header **headptr, int size)
     // Ask for memory
     void *memstart = sbrk(req_siz);
     // Check for errors
-    if(memstart < 0 )
+    if(memstart == (void*)-1)
     {
         throwmsg("MALLOC: Cannot sbrk");
         errno = ENOMEM;
         return -1;
     }
+    // Keep track of where the memory came from
+    addregion(memstart, req_siz);
+    // Take the page faults now rather than on first use.
+    // Done before formatting since the memory is clobbered.
+    if(prefault)
+    {
+        prefaultmem(memstart, req_siz);
+    }
     // Format memory appropriately
     formatmem(headptr, memstart, req_siz);
     // Assign it to heapstart if first time grabbing data
@@ -297,6 +343,48 @@ static int getmem(Header **headptr, int size)
     return 0;
 }
 
+static void addregion(void *memstart, int size)
+{
+    // Give every heap extension its own region while there's room
+    if(regioncount < MAX_REGIONS)
+    {
+        regions[regioncount].start = memstart;
+        regions[regioncount].size = size;
+        regioncount++;
+    }
+    else
+    {
+        // Anything past MAX_REGIONS is lumped in with the last region
+        struct Region *last = &regions[MAX_REGIONS - 1];
+        last->size = (memstart + size) - last->start;
+    }
+}
+
+static void prefaultmem(void *memstart, size_t size)
+{
+    static size_t pagesize = 0;
+    if(pagesize == 0)
+    {
+        long sys_pagesize = sysconf(_SC_PAGESIZE);
+        pagesize = sys_pagesize > 0 ? sys_pagesize : 4096;
+    }
+    // Write to one byte of each page so the kernel has to back it now.
+    // Only ever write: reading first would map the shared zero page
+    // and the write would then take a second, copy-on-write fault.
+    volatile char *mem = (volatile char*)memstart;
+    size_t offset = 0;
+    while(offset < size)
+    {
+        mem[offset] = 0;
+        offset += pagesize;
+    }
+    // Catch the last page if the loop stepped past it
+    if(size > 0)
+    {
+        mem[size - 1] = 0;
+    }
+}
+
 static void mergemem(Header *header)
 {
     // Check for free adjacent memory in previous chunk
@@ -340,6 +428,11 @@ extern void *malloc(size_t size)
     {
         return NULL;
     }
+    // Read the environment settings before touching the heap
+    if(!envinit)
+    {
+        initenv();
+    }
     // Adjust size for minimum size unit
     int adjusted_size = size + ((MIN_UNIT - (size % MIN_UNIT)) % MIN_UNIT);
     // Check for available memory
@@ -513,3 +606,227 @@ extern void *realloc(void *ptr, size_t size)
     }
     return header->mem_start;
 }
+
+extern int heapstats(HeapStats *stats)
+{
+    if(stats == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(HeapStats));
+    Header *chunk = heapstart;
+    while(chunk != NULL)
+    {
+        stats->header_bytes += headersize();
+        if(chunk->status == INUSE)
+        {
+            stats->inuse_bytes += chunk->mem_siz;
+            stats->inuse_chunks++;
+        }
+        else
+        {
+            stats->free_bytes += chunk->mem_siz;
+            stats->free_chunks++;
+            if(chunk->mem_siz > stats->largest_free)
+            {
+                stats->largest_free = chunk->mem_siz;
+            }
+            // Find the power-of-two bucket the chunk falls into
+            int bin = 0;
+            size_t bound = MIN_UNIT * 2;
+            while(chunk->mem_siz >= bound && bin < HEAP_HIST_BINS - 1)
+            {
+                bound *= 2;
+                bin++;
+            }
+            stats->free_hist[bin]++;
+        }
+        chunk = chunk->next;
+    }
+    int i = 0;
+    while(i < regioncount)
+    {
+        stats->heap_bytes += regions[i].size;
+        i++;
+    }
+    stats->regions = regioncount;
+    // With no free memory there is nothing to fragment
+    if(stats->free_bytes > 0)
+    {
+        stats->frag_ratio = 1.0 -
+        ((double)stats->largest_free / stats->free_bytes);
+    }
+    return 0;
+}
+
+extern void heapdump(int fd)
+{
+    // Written a piece at a time with write() since anything
+    // buffered through stdio could call back into malloc
+    HeapStats stats;
+    heapstats(&stats);
+    writemsg(fd, "{\"heap_bytes\":%zu,\"inuse_bytes\":%zu,"
+    "\"free_bytes\":%zu,\"header_bytes\":%zu,\"inuse_chunks\":%zu,"
+    "\"free_chunks\":%zu,\"largest_free\":%zu,\"frag_ratio\":%.6f,"
+    "\"free_hist\":[",
+    stats.heap_bytes, stats.inuse_bytes, stats.free_bytes,
+    stats.header_bytes, stats.inuse_chunks, stats.free_chunks,
+    stats.largest_free, stats.frag_ratio);
+    int i = 0;
+    while(i < HEAP_HIST_BINS)
+    {
+        writemsg(fd, "%s%zu", i == 0 ? "" : ",", stats.free_hist[i]);
+        i++;
+    }
+    // Break the heap down by region
+    writemsg(fd, "],\"regions\":[");
+    i = 0;
+    while(i < regioncount)
+    {
+        void *start = regions[i].start;
+        void *end = start + regions[i].size;
+        size_t inuse = 0;
+        size_t freed = 0;
+        Header *chunk = heapstart;
+        while(chunk != NULL)
+        {
+            // Merged chunks can span several regions, so only count
+            // the part of the chunk's memory inside this one
+            void *mem_start = chunk->mem_start;
+            void *mem_end = mem_start + chunk->mem_siz;
+            if(mem_start < start)
+            {
+                mem_start = start;
+            }
+            if(mem_end > end)
+            {
+                mem_end = end;
+            }
+            if(mem_start < mem_end)
+            {
+                if(chunk->status == INUSE)
+                {
+                    inuse += mem_end - mem_start;
+                }
+                else
+                {
+                    freed += mem_end - mem_start;
+                }
+            }
+            chunk = chunk->next;
+        }
+        writemsg(fd, "%s{\"source\":\"sbrk\",\"start\":\"%p\","
+        "\"size\":%zu,\"inuse_bytes\":%zu,\"free_bytes\":%zu,"
+        "\"utilization\":%.6f}",
+        i == 0 ? "" : ",", start, regions[i].size, inuse, freed,
+        (double)inuse / regions[i].size);
+        i++;
+    }
+    // Map out every chunk in heap order
+    writemsg(fd, "],\"chunks\":[");
+    Header *chunk = heapstart;
+    while(chunk != NULL)
+    {
+        writemsg(fd, "%s{\"start\":\"%p\",\"size\":%d,\"status\":\"%s\"}",
+        chunk == heapstart ? "" : ",", chunk->mem_start, chunk->mem_siz,
+        chunk->status == INUSE ? "inuse" : "free");
+        chunk = chunk->next;
+    }
+    writemsg(fd, "]}\n");
+}
+
+static void initenv()
+{
+    // Set first so any allocation made by atexit doesn't loop back here
+    envinit = 1;
+    const char *mode = getenv(PREFAULT_ENV);
+    if(mode != NULL && *mode != '\0' && strcmp(mode, "0") != 0)
+    {
+        prefault = 1;
+    }
+    if(getenv(HEAPDUMP_ENV) != NULL)
+    {
+        atexit(dumpatexit);
+    }
+}
+
+static void dumpatexit()
+{
+    const char *path = getenv(HEAPDUMP_ENV);
+    if(path == NULL || *path == '\0')
+    {
+        return;
+    }
+    if(strcmp(path, "stderr") == 0)
+    {
+        heapdump(STDERR_FILENO);
+        return;
+    }
+    // Append so that reports from several runs can be compared
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0)
+    {
+        throwmsg("MALLOC: Unable to open heap dump file");
+        return;
+    }
+    heapdump(fd);
+    close(fd);
+}
+
+extern void heapprefault(int enable)
+{
+    // Read the environment first so it can't override this later
+    if(!envinit)
+    {
+        initenv();
+    }
+    prefault = (enable != 0);
+}
+
+extern int heapreserve(size_t size)
+{
+    if(!envinit)
+    {
+        initenv();
+    }
+    // Leave room for the headers getmem adds on top
+    if(size == 0 || size > INT_MAX - (2 * headersize()) -
+    MIN_FREE_CHUNK_SIZ - MIN_UNIT)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // Adjust size for minimum size unit
+    int adjusted_size = size + ((MIN_UNIT - (size % MIN_UNIT)) % MIN_UNIT);
+    // Find the end of the heap
+    Header *last_chunk = heapstart;
+    while(last_chunk != NULL && last_chunk->next != NULL)
+    {
+        last_chunk = last_chunk->next;
+    }
+    // Have getmem warm the memory up whether or not prefault mode is on
+    Header *new_mem = NULL;
+    int prev_prefault = prefault;
+    prefault = 1;
+    int result = getmem(&new_mem, adjusted_size);
+    prefault = prev_prefault;
+    if(result != 0)
+    {
+        throwmsg("MALLOC: Unable to reserve heap memory");
+        return -1;
+    }
+    // Link it onto the end of the heap
+    new_mem->prev = last_chunk;
+    if(last_chunk != NULL)
+    {
+        last_chunk->next = new_mem;
+        // Join it with a free chunk at the end of the heap
+        // as long as nothing else moved the break in between
+        if(last_chunk->mem_start + last_chunk->mem_siz == (void*)new_mem)
+        {
+            mergemem(new_mem);
+        }
+    }
+    return 0;
+}
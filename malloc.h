@@ -4,6 +4,39 @@
 #ifndef MYMALLOC_HEADER
 #define MYMALLOC_HEADER
 
+// Number of power-of-two buckets in the free chunk
+// size histogram. Bucket i counts free chunks of
+// 2^(i+4) bytes up to (but not including) 2^(i+5)
+// bytes; the last bucket also holds anything larger.
+#define HEAP_HIST_BINS 24
+
+/* A snapshot of the heap's current layout
+ *  heap_bytes - total bytes obtained from sbrk
+ *  inuse_bytes - bytes handed out to the user
+ *  free_bytes - bytes in free chunks
+ *  header_bytes - bytes taken up by Headers
+ *  inuse_chunks - number of chunks in use
+ *  free_chunks - number of free chunks
+ *  largest_free - size of the largest free chunk
+ *  frag_ratio - external fragmentation, calculated
+ *               as 1 - largest_free / free_bytes
+ *  regions - number of heap regions (one per
+ *            extension of the heap)
+ *  free_hist - histogram of free chunk sizes
+ */
+typedef struct HeapStats {
+    size_t heap_bytes;
+    size_t inuse_bytes;
+    size_t free_bytes;
+    size_t header_bytes;
+    size_t inuse_chunks;
+    size_t free_chunks;
+    size_t largest_free;
+    double frag_ratio;
+    size_t regions;
+    size_t free_hist[HEAP_HIST_BINS];
+} HeapStats;
+
 /* Allocates memory of a given size
  *  size - size of memory to allocate
  * Returns a pointer to the start of
@@ -44,6 +77,51 @@ extern void *calloc(size_t nmemb, size_t size);
  */
 extern void *realloc(void *ptr, size_t size);
 
+/* Walks the heap and collects statistics
+ * about how its memory is being used.
+ *  stats - a pointer to the HeapStats
+ *          to fill in
+ * Returns 0 on success and -1 on failure
+ * Sets errno to EINVAL if stats is NULL
+ */
+extern int heapstats(HeapStats *stats);
+
+/* Writes a report of the heap to a file
+ * descriptor as a single line of JSON.
+ * The report holds everything in HeapStats
+ * plus the utilization of each heap region
+ * and a map of every chunk and its status.
+ * Setting the MALLOC_HEAPDUMP environment
+ * variable to a path (or "stderr") makes
+ * the library append a report there at exit.
+ *  fd - the file descriptor to write to
+ * Returns nothing
+ */
+extern void heapdump(int fd);
+
+/* Turns prefault mode on or off. While on,
+ * every page of memory newly taken from sbrk
+ * is touched right away so that page faults
+ * happen when the heap grows instead of on
+ * first use. Setting the MALLOC_PREFAULT
+ * environment variable to anything but "0"
+ * turns it on from startup.
+ *  enable - 1 to turn on, 0 to turn off
+ * Returns nothing
+ */
+extern void heapprefault(int enable);
+
+/* Grows the heap ahead of time and touches
+ * every page of the new memory, so that later
+ * allocations up to that size don't need to
+ * ask for memory or fault in pages.
+ *  size - the number of bytes to reserve
+ * Returns 0 on success and -1 on failure
+ * Sets errno to ENOMEM if no memory could be
+ * reserved or EINVAL if size is 0 or too large
+ */
+extern int heapreserve(size_t size);
+
 /* A data structure containing information
  * about each chunk of available memory
  *  mem_start - start address of available memory
@@ -89,6 +167,17 @@ static void formatmem(Header **headptr, void *memstart, int size);
 */
 static Header *divmem(Header *header, int size);
 
+/* Touches every page of a chunk of raw
+ * memory so the kernel backs it right away.
+ * Overwrites the memory, so it must be called
+ * before the memory is formatted.
+ *  memstart - a pointer to the starting
+ *             address of raw memory
+ *  size - the size in bytes of the raw memory
+ * Returns nothing
+ */
+static void prefaultmem(void *memstart, size_t size);
+
 /* Merges all free chunks of
  * memory before and after a given chunk.
  * header - a pointer to the header of the
@@ -123,6 +212,40 @@ static Header *shrinkmem(Header *header, int newsize);
 */
 static Header *getheader(void *ptr);
 
+/* Records memory taken from sbrk so that
+ * heap reports can show each region.
+ * Each call gets its own region until
+ * MAX_REGIONS is reached, after which the
+ * last region is stretched to cover the rest.
+ *  memstart - the start of the new memory
+ *  size - the size in bytes of the new memory
+ * Returns nothing
+ */
+static void addregion(void *memstart, int size);
+
+/* Reads the MALLOC_PREFAULT and MALLOC_HEAPDUMP
+ * environment variables, turning on prefault mode
+ * and registering the heap report to be written
+ * at exit if they're set.
+ * Only needs to be called once.
+ * Returns nothing
+ */
+static void initenv();
+
+/* Writes the heap report to the location
+ * named by MALLOC_HEAPDUMP.
+ * Returns nothing
+ */
+static void dumpatexit();
+
+/* Formats a message and writes it to
+ * a file descriptor.
+ *  fd - the file descriptor to write to
+ *  fmt - a printf style format string
+ * Returns nothing
+*/
+static void writemsg(int fd, const char *fmt, ...);
+
 // A small calculation of the size-aligned
 // memory needed for a Header
 static size_t headersize();